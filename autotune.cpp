@@ -0,0 +1,69 @@
+#include "autotune.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+namespace {
+
+constexpr auto cache_path = "autotune_profiles.txt";
+
+std::string CpuModel(){
+    std::string model;
+#ifdef _WIN32
+    char buf[256]{};
+    DWORD size = sizeof(buf);
+    if(RegGetValueA(HKEY_LOCAL_MACHINE , "HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0" ,
+        "ProcessorNameString" , RRF_RT_REG_SZ , nullptr , buf , &size) == ERROR_SUCCESS)
+        model = buf;
+#else
+    std::ifstream cpuinfo{"/proc/cpuinfo"};
+    for(std::string line ; std::getline(cpuinfo , line) ; ){
+        if(line.rfind("model name" , 0) != 0) continue;
+        model = line.substr(line.find(':') + 1);
+        break;
+    }
+#endif
+    auto not_space = [](unsigned char c){ return !std::isspace(c); };
+    model.erase(model.begin() , std::find_if(model.begin() , model.end() , not_space));
+    model.erase(std::find_if(model.rbegin() , model.rend() , not_space).base() , model.end());
+    if(model.empty()) model = "unknown_cpu";
+    // key is whitespace separated in cache file
+    std::replace_if(model.begin() , model.end() , [](unsigned char c){ return std::isspace(c); } , '_');
+    return model;
+}
+
+}
+
+std::string TuneKey(std::size_t shape_x , std::size_t shape_y , std::size_t grid_scale){
+    return CpuModel() +
+        "/" + std::to_string(std::thread::hardware_concurrency()) +
+        "/" + std::to_string(shape_x) + "x" + std::to_string(shape_y) +
+        "/" + std::to_string(grid_scale);
+}
+
+std::optional<TuneProfile> LoadTuneProfile(const std::string & key){
+    std::ifstream file{cache_path};
+    std::optional<TuneProfile> found;
+    // later lines override earlier ones
+    for(std::string line ; std::getline(file , line) ; ){
+        std::istringstream ss{line};
+        std::string k;
+        TuneProfile p;
+        if(ss >> k >> p.thread_pool >> p.num_threads >> p.chunk_size >> p.jacobian_step && k == key)
+            found = p;
+    }
+    return found;
+}
+
+void SaveTuneProfile(const std::string & key , const TuneProfile & p){
+    std::ofstream file{cache_path , std::ios::app};
+    file << key << ' ' << p.thread_pool << ' ' << p.num_threads << ' '
+         << p.chunk_size << ' ' << p.jacobian_step << '\n';
+}
@@ -1,16 +1,36 @@
 #include "mats.hpp"
 #include "fluid_solver.h"
+#include "autotune.h"
 #include <algorithm>
 #include <cmath>
+#include <omp.h>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <thread>
 
+// faces of a boundary cell that touch a wall or solid cell
+enum BLOCKED_FACE : std::uint8_t{ BLOCK_L = 1 , BLOCK_R = 2 , BLOCK_B = 4 , BLOCK_T = 8 };
+
+struct BoundaryCell{
+    Index2D index;
+    std::uint8_t blocked;   // BLOCKED_FACE bits
+};
 
 struct FluidSolver::Impl{
     //grids { pressure , velocity , dye , divergence , RGBA buffer }
+    //pressure / velocity / divergence live on the coarse grid (1/grid_scale of dye)
     Field<float> pressure , pressure_next;
     Field<Vec2f> velocity , velocity_next;
+    Field<Vec2f> dye_velocity;  // velocity upsampled to dye grid , unused when grid_scale == 1
     Field<Vec3f> dye , dye_next;
     Field<float> vel_divergence;
     Field<RGBA> color_buffer; //RGBA
+    BitMask solid;  // obstacle cells on velocity grid
+    std::vector<BoundaryCell> boundary; // fluid cells next to a wall or solid , sorted by row
+    std::vector<Index2D> solid_cells;   // sorted by row
+    std::vector<std::size_t> boundary_row , solid_row;  // row i starts at [i] , ends at [i + 1]
+    bool color_dirty;   // dye changed since color_buffer was last built
 
     Vec3f dye_color;  
     float decay;        // dyeing color decay
@@ -18,22 +38,49 @@ struct FluidSolver::Impl{
     int jocobian_step;  // for jocobian iteration 
     float f_strength;   // source emittion force strength 
     Vec2f f_gravity ;   // gravity force
-    Vec2f emit_source ; // smoke source
+    Vec2f emit_source ; // smoke source (dye grid coord)
+    std::unique_ptr<ThreadPool> pool; // nullptr : OpenMP
+    FluidConfig config; // last applied config
 
-    FluidSolver::Impl(std::size_t shape_x, std::size_t shape_y) 
-    : pressure(shape_x , shape_y) , pressure_next(shape_x,shape_y) 
-    , velocity(shape_x, shape_y) , velocity_next(shape_x,shape_y) 
+    FluidSolver::Impl(std::size_t shape_x, std::size_t shape_y , std::size_t vx , std::size_t vy) 
+    : pressure(vx , vy) , pressure_next(vx , vy) 
+    , velocity(vx , vy) , velocity_next(vx , vy) 
+    , dye_velocity(vx == shape_x ? 0 : shape_x , vy == shape_y ? 0 : shape_y)
     , dye(shape_x,  shape_y ) , dye_next(shape_x , shape_y)
-    , vel_divergence(shape_x, shape_y)
-    , color_buffer(shape_y ,shape_x){}
+    , vel_divergence(vx , vy)
+    , color_buffer(shape_y ,shape_x)
+    , solid(vx , vy){}
+
+    // cells of row i on velocity grid
+    std::span<const BoundaryCell> BoundaryRow(int i) const noexcept {
+        return {boundary.data() + boundary_row[i] , boundary.data() + boundary_row[i + 1]};
+    }
+    std::span<const Index2D> SolidRow(int i) const noexcept {
+        return {solid_cells.data() + solid_row[i] , solid_cells.data() + solid_row[i + 1]};
+    }
+
+    void BindExecutor(int chunk){
+        auto bind = [&](auto & f){
+            f.BindExecutor(pool.get());
+            f.SetChunkSize(chunk);
+        };
+        bind(pressure) , bind(pressure_next);
+        bind(velocity) , bind(velocity_next);
+        bind(dye_velocity);
+        bind(dye) , bind(dye_next);
+        bind(vel_divergence);
+        bind(color_buffer);
+    }
 };
 
-FluidSolver::FluidSolver(std::size_t shape_x, std::size_t shape_y , const FluidConfig & config)
+FluidSolver::FluidSolver(std::size_t shape_x, std::size_t shape_y , const FluidConfig & config , std::size_t grid_scale)
 : m_shape_x(shape_x) , m_shape_y(shape_y) 
-, m_impl(std::make_unique<Impl>(shape_x , shape_y)){
+, m_grid_scale(std::clamp<std::size_t>(grid_scale , 1 , std::min(shape_x , shape_y)))
+, m_impl(std::make_unique<Impl>(shape_x , shape_y , shape_x / m_grid_scale , shape_y / m_grid_scale)){
     Reset();
+    UpdateBoundary();
     SetColor(1,0,0);
-    SetConfig(config);
+    SetConfig(config.autotune ? Autotune(config) : config);
 }
 
 FluidSolver::~FluidSolver() {}
@@ -46,6 +93,10 @@ void FluidSolver::SolveStep(){
     UpdateDye();
 }
 
+void FluidSolver::SolveSteps(int n){
+    while(n-- > 0) SolveStep();
+}
+
 void FluidSolver::SetConfig(const FluidConfig & config){
     m_impl->decay = std::clamp(config.decay , 0.f , 1.f);
     m_impl->time_stamp = config.time_step;
@@ -53,6 +104,24 @@ void FluidSolver::SetConfig(const FluidConfig & config){
     m_impl->f_strength = 2000;
     m_impl->f_gravity = {config.gravity[0] , config.gravity[1]};
     m_impl->emit_source = {m_shape_x / 2 , 0};
+
+    auto threads = static_cast<std::size_t>(std::max(config.num_threads , 0));
+    // OpenMP thread count before any solver changed it (OMP_NUM_THREADS etc.)
+    static const int default_omp_threads = omp_get_max_threads();
+    if(!config.thread_pool) {
+        m_impl->pool.reset();
+        omp_set_num_threads(threads > 0 ? static_cast<int>(threads) : default_omp_threads);
+    }
+    else if(!m_impl->pool || (threads > 0 && m_impl->pool->Size() != threads)) {
+        m_impl->pool.reset();   // join old workers before spawning new ones
+        m_impl->pool = std::make_unique<ThreadPool>(threads);
+    }
+    m_impl->BindExecutor(config.chunk_size > 0 ? config.chunk_size : 8);
+    m_impl->config = config;
+}
+
+FluidConfig FluidSolver::GetConfig() const noexcept {
+    return m_impl->config;
 }
 
 void FluidSolver::SetColor(float r , float g , float b){
@@ -60,9 +129,68 @@ void FluidSolver::SetColor(float r , float g , float b){
 }
 
 std::span<const RGBA> FluidSolver::GetColors() const noexcept {
+    if(m_impl->color_dirty) UpdateColorBuffer();
     return m_impl->color_buffer.Span();
 }
 
+void FluidSolver::AddObstacle(float x , float y , float radius){
+    auto & solid = m_impl->solid;
+    const int nx = solid.XSize() , ny = solid.YSize();
+    float scale = m_grid_scale;
+    for(int i = 0 ; i < nx ; ++i) for(int j = 0 ; j < ny ; ++j) {
+        auto d2 = ((Vec2f{i , j} + 0.5f) * scale - Vec2f{x , y}).square().sum();
+        if(d2 < radius * radius) solid.Set({i , j} , true);
+    }
+    UpdateBoundary();
+}
+
+void FluidSolver::ClearObstacles(){
+    m_impl->solid.Clear();
+    UpdateBoundary();
+}
+
+void FluidSolver::UpdateBoundary(){
+    auto & solid = m_impl->solid;
+    const int nx = solid.XSize() , ny = solid.YSize();
+    auto blocked_at = [&](int i , int j){
+        return i < 0 || j < 0 || i >= nx || j >= ny || solid.Test({i , j});
+    };
+    m_impl->boundary.clear();
+    m_impl->solid_cells.clear();
+    m_impl->boundary_row.assign(1 , 0);
+    m_impl->solid_row.assign(1 , 0);
+    for(int i = 0 ; i < nx ; ++i) for(int j = 0 ; j < ny ; ++j) {
+        if(j == 0 && i > 0) {
+            m_impl->boundary_row.push_back(m_impl->boundary.size());
+            m_impl->solid_row.push_back(m_impl->solid_cells.size());
+        }
+        if(solid.Test({i , j})) {
+            m_impl->solid_cells.push_back({i , j});
+            continue;
+        }
+        std::uint8_t blocked = 
+            (blocked_at(i - 1 , j) ? BLOCK_L : 0) | (blocked_at(i + 1 , j) ? BLOCK_R : 0) |
+            (blocked_at(i , j - 1) ? BLOCK_B : 0) | (blocked_at(i , j + 1) ? BLOCK_T : 0) ;
+        // outer ring always has a blocked face
+        if(blocked) m_impl->boundary.push_back({{i , j} , blocked});
+    }
+    m_impl->boundary_row.push_back(m_impl->boundary.size());
+    m_impl->solid_row.push_back(m_impl->solid_cells.size());
+}
+
+// neighbors {l , r , b , t} of a boundary cell , blocked faces take the center value (Neumann)
+template<class T>
+std::array<T , 4> BoundaryNeighbors(Field<T> & f , const BoundaryCell & cell) {
+    auto & [i , j] = cell.index;
+    auto c = f[cell.index];
+    return {
+        cell.blocked & BLOCK_L ? c : f[{i - 1 , j}] ,
+        cell.blocked & BLOCK_R ? c : f[{i + 1 , j}] ,
+        cell.blocked & BLOCK_B ? c : f[{i , j - 1}] ,
+        cell.blocked & BLOCK_T ? c : f[{i , j + 1}] ,
+    };
+}
+
 template<class T>
 auto LinearInterpolate(const T& a ,const T& b , float t) {
     return a + t * (b - a);
@@ -121,75 +249,123 @@ void FluidSolver::Advection(){
         });
     };
 
+    // dye is traced with the velocity upsampled to its own resolution
+    UpsampleVelocity();
+    auto & dye_vf = m_grid_scale > 1 ? m_impl->dye_velocity : m_impl->velocity;
+
     do_advect(m_impl->velocity , m_impl->velocity , m_impl->velocity_next);
-    do_advect(m_impl->velocity , m_impl->dye , m_impl->dye_next);
+    do_advect(dye_vf , m_impl->dye , m_impl->dye_next);
 
     m_impl->velocity.SwapWith(m_impl->velocity_next);
     m_impl->dye.SwapWith(m_impl->dye_next);
 }
 
+void FluidSolver::UpsampleVelocity(){
+    if(m_grid_scale == 1) return;
+    float scale = m_grid_scale;
+    float inv_scale = 1.0f / scale;
+    // keep samples between coarse cell centers , BilinearInterpolate truncates toward zero
+    Vec2f pos_min = {0.5f , 0.5f};
+    Vec2f pos_max = {m_impl->velocity.XSize() - 0.5f , m_impl->velocity.YSize() - 0.5f};
+    m_impl->dye_velocity.ForEach([&](Vec2f & v , Index2D index){
+        // dye cell center -> coarse grid coord , coarse cell/s -> dye cell/s
+        Vec2f pos = ((Vec2f{index.i , index.j} + 0.5f) * inv_scale).max(pos_min).min(pos_max);
+        v = BilinearInterpolate(m_impl->velocity , pos) * scale;
+    });
+}
+
 void FluidSolver::Reset(){
     // fill init values into fields
     m_impl->velocity.Fill({0,0});
+    m_impl->dye_velocity.Fill({0,0});
     m_impl->dye.Fill({0,0,0});
     m_impl->color_buffer.Fill({});
+    m_impl->color_dirty = false;
     m_impl->pressure.Fill(0.f);
 }
 
 void FluidSolver::ExternalForce(){
-    // handle smoke source 
-    auto f_strength_dt = m_impl->f_strength * m_impl->time_stamp;
+    // handle smoke source , forces are measured in coarse grid cells
+    float inv_scale = 1.0f / m_grid_scale;
+    auto f_strength_dt = m_impl->f_strength * m_impl->time_stamp * inv_scale;
     // auto f_r = m_shape_x / 3.0f;
     // auto inv_f_r = 1.0f / f_r;
-    auto f_g_dt = m_impl->f_gravity * m_impl->time_stamp;
+    auto f_g_dt = m_impl->f_gravity * m_impl->time_stamp * inv_scale;
+    Vec2f source = m_impl->emit_source * inv_scale;
+    float radius2 = 400 * inv_scale * inv_scale;
     
     m_impl->velocity.ForEach([&](Vec2f & v , const Index2D & index){
-        auto d2 = (Vec2f{index.i , index.j} + 0.5 - m_impl->emit_source).square().sum();
+        auto d2 = (Vec2f{index.i , index.j} + 0.5 - source).square().sum();
         // auto momentum = Vec2f{0 , 1} * f_strength_dt * std::exp(-d2 * inv_f_r) - f_g_dt;
         Vec2f momentum = f_g_dt;
-        if(d2 < 400) momentum += Vec2f{0 , 1} * f_strength_dt ;
+        if(d2 < radius2) momentum += Vec2f{0 , 1} * f_strength_dt ;
         v += momentum;
     });
 }
 
-void FluidSolver::Projection(){
-    //velocity divergence 
-    m_impl->vel_divergence.ForEach([&](float & div , Index2D index){
+// Notes : interior kernels below read neighbors without any wall / solid check ,
+// cells in m_impl->boundary are then overwritten by the per-row fix-ups ,
+// which run in the same pass on the thread owning that row
+
+void FluidSolver::ComputeDivergence(){
+    auto & vel = m_impl->velocity;
+    auto & div = m_impl->vel_divergence;
+    div.ForEachInterior([&](float & d , Index2D index){
         auto & [i , j] = index;
-        auto vl = m_impl->velocity.Sample({i - 1 , j})[0];
-        auto vr = m_impl->velocity.Sample({i + 1 , j})[0];
-        auto vb = m_impl->velocity.Sample({i , j - 1})[1];
-        auto vt = m_impl->velocity.Sample({i , j + 1})[1];
-        auto vc = m_impl->velocity[index];
-        if(i == 0) vl = 0 ;
-        else if(i == m_shape_x - 1) vr = 0 ;
-        if(j == 0) vb = 0;
-        else if(j == m_shape_y - 1) vt = 0;
-        div = (vr - vl + vt - vb) * 0.5 ;   // 1/(2 dx) = 0.5
+        d = (vel[{i + 1 , j}][0] - vel[{i - 1 , j}][0] + vel[{i , j + 1}][1] - vel[{i , j - 1}][1]) * 0.5 ;   // 1/(2 dx) = 0.5
+    } , [&](int row){
+        // no-penetration : blocked faces have zero normal velocity
+        for(auto & cell : m_impl->BoundaryRow(row)) {
+            auto & [i , j] = cell.index;
+            auto vl = cell.blocked & BLOCK_L ? 0.f : vel[{i - 1 , j}][0];
+            auto vr = cell.blocked & BLOCK_R ? 0.f : vel[{i + 1 , j}][0];
+            auto vb = cell.blocked & BLOCK_B ? 0.f : vel[{i , j - 1}][1];
+            auto vt = cell.blocked & BLOCK_T ? 0.f : vel[{i , j + 1}][1];
+            div[cell.index] = (vr - vl + vt - vb) * 0.5 ;
+        }
+        for(auto & index : m_impl->SolidRow(row)) div[index] = 0;
     });
+}
+
+void FluidSolver::Projection(){
+    //velocity divergence 
+    ComputeDivergence();
     //jacobian iteration 
     int times = m_impl->jocobian_step;
     while(times--){
         //jacobian step , solve pressure
-        m_impl->pressure_next.ForEach([&](float & p , const Index2D & index){
-            // neighborsum fast hack
-            auto s = m_impl->pressure.NeighborSum(index);
-            auto vdiv = m_impl->vel_divergence[index];
-            p = 0.25 * (s - vdiv);
+        auto & p_cur = m_impl->pressure;
+        auto & p_next = m_impl->pressure_next;
+        p_next.ForEachInterior([&](float & p , const Index2D & index){
+            auto & [i , j] = index;
+            auto s = p_cur[{i - 1 , j}] + p_cur[{i + 1 , j}] + p_cur[{i , j - 1}] + p_cur[{i , j + 1}];
+            p = 0.25 * (s - m_impl->vel_divergence[index]);
+        } , [&](int row){
+            for(auto & cell : m_impl->BoundaryRow(row)) {
+                auto [pl , pr , pb , pt] = BoundaryNeighbors(p_cur , cell);
+                p_next[cell.index] = 0.25 * (pl + pr + pb + pt - m_impl->vel_divergence[cell.index]);
+            }
         });
         m_impl->pressure_next.SwapWith(m_impl->pressure);
     }
 }
 
 void FluidSolver::UpdateVelocity(){
-    m_impl->velocity.ForEach([&](Vec2f & v , const Index2D & index){
+    auto & p = m_impl->pressure;
+    auto & vel = m_impl->velocity;
+    auto & vel_next = m_impl->velocity_next;
+    vel_next.ForEachInterior([&](Vec2f & v , const Index2D & index){
         auto & [i, j] = index;
-        auto pl = m_impl->pressure.Sample({i - 1 , j});
-        auto pr = m_impl->pressure.Sample({i + 1 , j});
-        auto pb = m_impl->pressure.Sample({i , j - 1});
-        auto pt = m_impl->pressure.Sample({i , j + 1});
-        v -= 0.5 * Vec2f{pr - pl , pt - pb};
+        v = vel[index] - 0.5 * Vec2f{p[{i + 1 , j}] - p[{i - 1 , j}] , p[{i , j + 1}] - p[{i , j - 1}]};
+    } , [&](int row){
+        for(auto & cell : m_impl->BoundaryRow(row)) {
+            auto [pl , pr , pb , pt] = BoundaryNeighbors(p , cell);
+            vel_next[cell.index] = vel[cell.index] - 0.5 * Vec2f{pr - pl , pt - pb};
+        }
+        // no-slip : solid cells don't move
+        for(auto & index : m_impl->SolidRow(row)) vel_next[index] = {0 , 0};
     });
+    m_impl->velocity.SwapWith(m_impl->velocity_next);
 }
 
 void FluidSolver::UpdateDye(){
@@ -202,8 +378,16 @@ void FluidSolver::UpdateDye(){
         // if(d2 < 400) d = dc.cwiseMin(m_impl->dye_color);
         // else d = dc.cwiseMin(1.f);
     });
+    // no dye inside obstacles
+    const int scale = m_grid_scale;
+    for(auto & [i , j] : m_impl->solid_cells) {
+        for(int di = 0 ; di < scale ; ++di) for(int dj = 0 ; dj < scale ; ++dj)
+            m_impl->dye[{i * scale + di , j * scale + dj}] = {0 , 0 , 0};
+    }
+    m_impl->color_dirty = true;
+}
 
-    //update color buffer
+void FluidSolver::UpdateColorBuffer() const noexcept{
     m_impl->color_buffer.ForEach([&](RGBA & col , Index2D index){
         index = {index.j , static_cast<int>(m_shape_y) - 1 - index.i};
         auto & fcol = m_impl->dye[index];
@@ -212,4 +396,115 @@ void FluidSolver::UpdateDye(){
         };
         col = {tou8(fcol[0]) , tou8(fcol[1]) , tou8(fcol[2]) , 255};
     });
-}
\ No newline at end of file
+    m_impl->color_dirty = false;
+}
+
+constexpr int tune_warmup_steps = 20;   // let the flow develop before measuring
+constexpr int tune_bench_steps = 3;
+constexpr int tune_bench_repeats = 5;   // best of repeats filters out scheduler noise
+constexpr double tune_margin = 0.1;     // a candidate must be this much faster to replace current best
+constexpr int tune_bench_jacobi = 20;   // timing runs only , solve cost is linear in jacobi steps
+constexpr int tune_reference_jacobi = 1000;  // near converged pressure solve to compare against
+constexpr double tune_tolerance = 0.02;      // extra share of reference correction fewer steps may miss
+
+// Notes : benchmarks run on this solver's own grids , state is reset afterwards
+
+FluidConfig FluidSolver::Autotune(FluidConfig config){
+    config.autotune = false;
+    auto apply = [&config](const TuneProfile & p){
+        auto c = config;
+        c.thread_pool = p.thread_pool;
+        c.num_threads = p.num_threads;
+        c.chunk_size = p.chunk_size;
+        c.jacobian_step = p.jacobian_step;
+        return c;
+    };
+    auto key = TuneKey(m_shape_x , m_shape_y , m_grid_scale);
+    if(auto profile = LoadTuneProfile(key)) return apply(*profile);
+
+    // fastest of tune_bench_repeats runs of tune_bench_steps steps , in seconds
+    auto bench = [&](TuneProfile p){
+        p.jacobian_step = tune_bench_jacobi;
+        SetConfig(apply(p));
+        SolveStep();    // warm up caches and workers
+        auto fastest = std::numeric_limits<double>::max();
+        for(int k = 0 ; k < tune_bench_repeats ; ++k) {
+            auto beg = std::chrono::steady_clock::now();
+            SolveSteps(tune_bench_steps);
+            fastest = std::min(fastest , std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count());
+        }
+        return fastest;
+    };
+    auto best_time = 0.0;
+    auto best = TuneProfile{};
+    auto try_candidate = [&](const TuneProfile & p){
+        if(auto t = bench(p) ; t < best_time * (1 - tune_margin)) best = p , best_time = t;
+    };
+
+    SetConfig(config);
+    SolveSteps(tune_warmup_steps);
+    // jacobi candidates restart from this state , independent of the timing runs below
+    auto velocity = m_impl->velocity;
+    auto pressure = m_impl->pressure;
+
+    // executor and thread count , the caller's settings stay unless clearly beaten
+    const int hw = std::max(1u , std::thread::hardware_concurrency());
+    const int chunk = config.chunk_size > 0 ? config.chunk_size : 8;
+    const int threads = config.num_threads > 0 ? config.num_threads : hw;
+    best = TuneProfile{config.thread_pool , threads , chunk , config.jacobian_step};
+    best_time = bench(best);
+    for(int t = hw ; t >= 1 ; t /= 2) {
+        for(bool pool : {false , true}) {
+            if(pool == config.thread_pool && t == threads) continue;
+            try_candidate({pool , t , chunk , config.jacobian_step});
+        }
+    }
+    // chunk size only matters for OpenMP dynamic schedule
+    if(!best.thread_pool) {
+        for(int c : {1 , 2 , 4 , 8 , 16 , 32 , 64}) {
+            if(c == best.chunk_size) continue;
+            auto p = best;
+            p.chunk_size = c;
+            try_candidate(p);
+        }
+    }
+    // jacobi steps : accuracy is measured as the share of the reference pressure correction
+    // a projection misses. Fewer steps than the caller's are taken only when they miss
+    // at most tune_tolerance more than the caller's steps do , never more steps.
+    SetConfig(apply(best));
+    // one step from the snapshot , return {velocity before , after projection}
+    auto project = [&](int steps){
+        m_impl->velocity = velocity;
+        m_impl->pressure = pressure;
+        m_impl->jocobian_step = steps;
+        Advection();
+        ExternalForce();
+        auto before = m_impl->velocity;
+        Projection();
+        UpdateVelocity();
+        return std::pair{std::move(before) , m_impl->velocity};
+    };
+    auto distance = [](const Field<Vec2f> & a , const Field<Vec2f> & b){
+        double sum = 0;
+        for(std::size_t k = 0 ; k < a.Span().size() ; ++k) sum += (a.Span()[k] - b.Span()[k]).abs().sum();
+        return sum;
+    };
+    auto [before , reference] = project(tune_reference_jacobi);
+    auto correction = distance(before , reference);
+    auto missed = [&](int steps){
+        return correction > 0 ? distance(project(steps).second , reference) / correction : 0.0;
+    };
+    auto allowed = missed(config.jacobian_step) + tune_tolerance;
+    best.jacobian_step = config.jacobian_step;
+    for(int steps : {10 , 20 , 40 , 80 , 160 , 320}) {
+        if(steps >= config.jacobian_step) break;
+        if(missed(steps) <= allowed) {
+            best.jacobian_step = steps;
+            break;
+        }
+    }
+
+    Reset();
+    SaveTuneProfile(key , best);
+    return apply(best);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+// winning solver settings for one (cpu , grid shape)
+struct TuneProfile{
+    bool thread_pool;
+    int num_threads;
+    int chunk_size;
+    int jacobian_step;
+};
+
+// key of a profile in cache , built from cpu model and grid shape
+std::string TuneKey(std::size_t shape_x , std::size_t shape_y , std::size_t grid_scale);
+
+// profiles are cached as text lines in the working directory
+std::optional<TuneProfile> LoadTuneProfile(const std::string & key);
+void SaveTuneProfile(const std::string & key , const TuneProfile & profile);
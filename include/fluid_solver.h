@@ -10,19 +10,30 @@ struct FluidConfig{
     float decay ;
     float time_step;
     float gravity[2];
+    bool thread_pool;   // persistent worker pool instead of OpenMP fork/join
+    int num_threads;    // 0 : hardware concurrency
+    int chunk_size;     // OpenMP rows per chunk , 0 : default
+    bool autotune;      // on construction , load or benchmark best settings for this machine & shape
 };
 
 class FluidSolver{
 public:
-    explicit FluidSolver(std::size_t, std::size_t , const FluidConfig& ); 
+    // grid_scale : velocity / pressure grid is 1/grid_scale of the dye resolution
+    explicit FluidSolver(std::size_t, std::size_t , const FluidConfig& , std::size_t grid_scale = 1); 
     ~FluidSolver();
     FluidSolver(const FluidSolver & ) = delete;
     FluidSolver & operator=(const FluidSolver & ) = delete;
 
     void SolveStep();
+    void SolveSteps(int n);
     void Reset();
     void SetColor(float r, float g , float b );
     void SetConfig(const FluidConfig & );
+    FluidConfig GetConfig() const noexcept;
+    // static solid obstacles , (x , y , radius) in dye grid coord
+    void AddObstacle(float x , float y , float radius);
+    void ClearObstacles();
+    // RGBA buffer is converted from dye lazily , only when dye changed since last call
     std::span<const RGBA> GetColors() const noexcept ;
     
     void RunBench();
@@ -33,10 +44,16 @@ private:
     void Projection();
     void UpdateVelocity();
     void UpdateDye();
+    void UpsampleVelocity();
+    void UpdateColorBuffer() const noexcept;
+    void UpdateBoundary();
+    void ComputeDivergence();
+    FluidConfig Autotune(FluidConfig);
 
 private :
     struct Impl ;
     std::size_t m_shape_x ;
     std::size_t m_shape_y ;
+    std::size_t m_grid_scale ;
     std::unique_ptr<Impl> m_impl;
 };
\ No newline at end of file
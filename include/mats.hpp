@@ -2,9 +2,12 @@
 
 #include <cassert>
 #include <concepts>
+#include <cstdint>
+#include <vector>
 #include <Eigen/Eigen>
 #include <span>
 #include <algorithm>
+#include "thread_pool.h"
 
 using Vec2f = Eigen::Array2f;
 using Vec3f = Eigen::Array3f;
@@ -29,16 +32,30 @@ public:
     std::size_t XSize() const noexcept {return m_shape_x;}
     std::size_t YSize() const noexcept {return m_shape_y;}
 
+    // run ForEach on a persistent pool instead of OpenMP , nullptr for OpenMP
+    void BindExecutor(ThreadPool * pool) noexcept {m_pool = pool;}
+    // rows per OpenMP dynamic schedule chunk
+    void SetChunkSize(int chunk) noexcept {m_chunk = std::max(chunk , 1);}
+
     template<std::invocable<V & , Index2D> F>
     void ForEach(F && f) noexcept(noexcept(std::forward<F>(f)(m_data[0] , {0,0}))) {
-        // coord (i, j) should be signed integer
-        #pragma omp parallel for schedule (dynamic , 8)
-        for(int i = 0; i < m_shape_x ; ++i) { 
-            auto index = Index2D{i, 0};
-            for(int pos = i * m_shape_y; index.j < m_shape_y ; ++index.j , ++pos) {
-                std::forward<F>(f)(m_data[pos] , index);
-            }
-        }
+        ForRows([&](int i){ VisitRow(i , 0 , m_shape_y , f); });
+    }
+
+    // skip the outermost ring , every cell visited has all 4 neighbors in range
+    template<std::invocable<V & , Index2D> F>
+    void ForEachInterior(F && f) noexcept(noexcept(std::forward<F>(f)(m_data[0] , {0,0}))) {
+        ForEachInterior(std::forward<F>(f) , [](int){});
+    }
+
+    // ForEachInterior , then fix(i) for every row i (outer rows included) on the thread
+    // owning row i , so per-row boundary fix-ups keep the same row-to-thread mapping
+    template<std::invocable<V & , Index2D> F , std::invocable<int> G>
+    void ForEachInterior(F && f , G && fix) {
+        ForRows([&](int i){
+            if(i > 0 && i < m_maxi) VisitRow(i , 1 , m_maxj , f);
+            fix(i);
+        });
     }
 
     V & operator[] (const Index2D & index) noexcept{
@@ -80,11 +97,67 @@ public:
         std::swap(m_shape_y , f.m_shape_y);
         std::swap(m_data, f.m_data);
     }
+private:
+    // visit row i , j in [j_beg , j_end)
+    template<class F>
+    void VisitRow(int i , int j_beg , int j_end , F && f) {
+        // coord (i, j) should be signed integer
+        auto index = Index2D{i, j_beg};
+        for(int pos = i * m_shape_y + j_beg; index.j < j_end ; ++index.j , ++pos) {
+            f(m_data[pos] , index);
+        }
+    }
+
+    // run row(i) for every row , all passes share the same row partition
+    template<class R>
+    void ForRows(R && row) {
+        if(m_pool) {
+            m_pool->ParallelFor(static_cast<int>(m_shape_x) , row);
+            return;
+        }
+        #pragma omp parallel for schedule (dynamic , m_chunk)
+        for(int i = 0; i < m_shape_x ; ++i) row(i);
+    }
+
 private:
     std::size_t m_shape_x;
     std::size_t m_shape_y;
     int m_maxi;
     int m_maxj;
     std::vector<V> m_data{};
+    ThreadPool * m_pool{};
+    int m_chunk{8};
 };
 
+// bit-packed boolean grid , same (i , j) layout as Field
+class BitMask{
+public:
+    explicit BitMask(std::size_t shape_x , std::size_t shape_y)
+    :m_shape_x(shape_x) , m_shape_y(shape_y)
+    ,m_bits((shape_x * shape_y + 63) / 64){}
+
+    std::size_t XSize() const noexcept {return m_shape_x;}
+    std::size_t YSize() const noexcept {return m_shape_y;}
+
+    bool Test(const Index2D & index) const noexcept {
+        auto pos = index.i * m_shape_y + index.j ;
+        assert(pos < m_shape_x * m_shape_y);
+        return (m_bits[pos >> 6] >> (pos & 63)) & 1;
+    }
+
+    void Set(const Index2D & index , bool val) noexcept {
+        auto pos = index.i * m_shape_y + index.j ;
+        assert(pos < m_shape_x * m_shape_y);
+        auto bit = std::uint64_t{1} << (pos & 63);
+        if(val) m_bits[pos >> 6] |= bit;
+        else m_bits[pos >> 6] &= ~bit;
+    }
+
+    void Clear() noexcept {
+        std::fill(m_bits.begin() , m_bits.end() , 0);
+    }
+private:
+    std::size_t m_shape_x;
+    std::size_t m_shape_y;
+    std::vector<std::uint64_t> m_bits{};
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool for row-parallel field passes.
+// Rows are split into Size() contiguous blocks , block k always runs on worker k ,
+// so every pass over same-shaped fields touches the same rows on the same core.
+// The calling thread runs block 0 and waits on a spin barrier for the others ,
+// the pool must be constructed , driven and destroyed on that same thread.
+class ThreadPool{
+public:
+    // num_threads == 0 : use hardware concurrency
+    explicit ThreadPool(std::size_t num_threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    std::size_t Size() const noexcept { return m_workers.size() + 1; }
+
+    // run f(row) for every row in [0 , rows) , return when all rows are done
+    template<std::invocable<int> F>
+    void ParallelFor(int rows , F && f) {
+        auto task = [](void * ctx , int beg , int end){
+            auto & fn = *static_cast<std::remove_reference_t<F> *>(ctx);
+            for(int i = beg ; i < end ; ++i) fn(i);
+        };
+        Dispatch(rows , task , static_cast<void *>(std::addressof(f)));
+    }
+
+private:
+    using Task = void (*)(void * , int , int);
+
+    void Dispatch(int rows , Task task , void * ctx);
+    void RunBlock(std::size_t id) noexcept;
+    void WorkerLoop(std::size_t id);
+
+private:
+    std::vector<std::thread> m_workers;
+    std::atomic<std::uint64_t> m_generation{0};
+    std::atomic<int> m_pending{0};
+    std::atomic<bool> m_stop{false};
+    Task m_task{};
+    void * m_ctx{};
+    int m_rows{};
+    std::vector<std::size_t> m_caller_cores;   // calling thread affinity before pinning
+};
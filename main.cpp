@@ -16,14 +16,26 @@ using namespace std::string_literals;
 
 int main(){
     constexpr std::size_t resolution = 512;
+    // velocity / pressure grid runs at resolution / grid_scale
+    constexpr std::size_t grid_scale = 1;
+    // solver steps run before each displayed frame
+    constexpr int steps_per_frame = 1;
     auto config = FluidConfig{
         .jacobian_step = 100,
         .decay = 0.999,
         .time_step = 0.015,
         .gravity = {0,0},
+        .thread_pool = false,
+        .num_threads = 0,
+        .chunk_size = 8,
+        // opt-in : benchmarks for seconds on first launch per cpu & shape ,
+        // profile is cached in autotune_profiles.txt in working directory
+        .autotune = false,
     };
     auto gui = GUI{resolution,resolution};
-    auto solver = FluidSolver{resolution,resolution, config};
+    auto solver = FluidSolver{resolution,resolution, config , grid_scale};
+    // show autotuned settings
+    config = solver.GetConfig();
     
     // GUI states
     bool paused = false;
@@ -32,6 +44,8 @@ int main(){
     bool setdecay = false;
     float color[3] = {1.0f , 0.f , 0.f};
     bool setcolor = false;
+    bool obstacle = false;
+    bool setobstacle = false;
 
     // main loop 
     while(true){
@@ -42,7 +56,12 @@ int main(){
         if(update) solver.SetConfig(config) , update = false;
         if(setcolor) solver.SetColor(color[0] , color[1] , color[2]) , setcolor = false;
         if(reset) solver.Reset() , reset = false;
-        if(!paused) solver.SolveStep();
+        if(setobstacle) {
+            solver.ClearObstacles();
+            if(obstacle) solver.AddObstacle(resolution / 2.f , resolution / 4.f , resolution / 16.f);
+            setobstacle = false;
+        }
+        if(!paused) solver.SolveSteps(steps_per_frame);
         // update ui & window
         gui.UpdateFrameBuffer(solver.GetColors());
         // Render GUI
@@ -69,8 +88,13 @@ int main(){
             ImGui::InputFloat("decay" , &config.decay);
             ImGui::InputInt("jacobian step" , &config.jacobian_step);
             ImGui::InputFloat2("gravity" , config.gravity);
+            ImGui::Checkbox("thread pool" , &config.thread_pool);
+            ImGui::InputInt("threads" , &config.num_threads);
+            ImGui::InputInt("chunk size" , &config.chunk_size);
             if(ImGui::Button("Update" )) 
                 update = true;
+            if(ImGui::Checkbox("obstacle" , &obstacle))
+                setobstacle = true;
             
             ImGui::Separator();
             auto picker_flag = 
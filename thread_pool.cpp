@@ -0,0 +1,114 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace {
+
+// busy-wait iterations before a worker falls back to a blocking wait
+constexpr int spin_limit = 1 << 14;
+
+using ThreadHandle = std::thread::native_handle_type;
+
+ThreadHandle CurrentThread(){
+#ifdef _WIN32
+    return GetCurrentThread();
+#elif defined(__linux__)
+    return pthread_self();
+#else
+    return {};
+#endif
+}
+
+// restrict thread to given cores , return previously allowed cores (empty if unchanged)
+std::vector<std::size_t> SetAffinity(ThreadHandle h , const std::vector<std::size_t> & cores){
+    std::vector<std::size_t> old;
+#ifdef _WIN32
+    // one affinity mask only addresses the cores of a single processor group
+    constexpr std::size_t mask_bits = sizeof(DWORD_PTR) * 8;
+    DWORD_PTR mask = 0;
+    for(auto c : cores) if(c < mask_bits) mask |= DWORD_PTR{1} << c;
+    if(mask == 0) return old;
+    auto prev = SetThreadAffinityMask(h , mask);
+    for(std::size_t c = 0 ; c < mask_bits ; ++c) if((prev >> c) & 1) old.push_back(c);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto c : cores) if(c < CPU_SETSIZE) CPU_SET(c , &set);
+    if(CPU_COUNT(&set) == 0) return old;
+    cpu_set_t prev;
+    if(pthread_getaffinity_np(h , sizeof(prev) , &prev) != 0) return old;
+    if(pthread_setaffinity_np(h , sizeof(set) , &set) != 0) return old;
+    for(std::size_t c = 0 ; c < CPU_SETSIZE ; ++c) if(CPU_ISSET(c , &prev)) old.push_back(c);
+#endif
+    return old;
+}
+
+std::vector<std::size_t> PinToCore(ThreadHandle h , std::size_t core){
+    auto n = std::thread::hardware_concurrency();
+    if(n == 0) return {};
+    return SetAffinity(h , {core % n});
+}
+
+}
+
+ThreadPool::ThreadPool(std::size_t num_threads){
+    if(num_threads == 0) num_threads = std::max(1u , std::thread::hardware_concurrency());
+    // calling thread works as block 0 on core 0 , its old affinity is restored on destruction
+    m_caller_cores = PinToCore(CurrentThread() , 0);
+    m_workers.reserve(num_threads - 1);
+    for(std::size_t id = 1 ; id < num_threads ; ++id){
+        m_workers.emplace_back([this , id]{ WorkerLoop(id); });
+        PinToCore(m_workers.back().native_handle() , id);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    m_stop.store(true , std::memory_order_relaxed);
+    m_generation.fetch_add(1 , std::memory_order_release);
+    m_generation.notify_all();
+    for(auto & t : m_workers) t.join();
+    if(!m_caller_cores.empty()) SetAffinity(CurrentThread() , m_caller_cores);
+}
+
+void ThreadPool::Dispatch(int rows , Task task , void * ctx){
+    m_task = task;
+    m_ctx = ctx;
+    m_rows = rows;
+    m_pending.store(static_cast<int>(m_workers.size()) , std::memory_order_relaxed);
+    m_generation.fetch_add(1 , std::memory_order_release);
+    m_generation.notify_all();
+
+    RunBlock(0);
+
+    // barrier : wait for the other blocks
+    for(int spin = 0 ; m_pending.load(std::memory_order_acquire) != 0 ; ++spin){
+        if(spin >= spin_limit) std::this_thread::yield();
+    }
+}
+
+void ThreadPool::RunBlock(std::size_t id) noexcept{
+    auto n = static_cast<std::int64_t>(Size());
+    auto beg = static_cast<int>(m_rows * static_cast<std::int64_t>(id) / n);
+    auto end = static_cast<int>(m_rows * static_cast<std::int64_t>(id + 1) / n);
+    if(beg < end) m_task(m_ctx , beg , end);
+}
+
+void ThreadPool::WorkerLoop(std::size_t id){
+    std::uint64_t seen = 0;
+    while(true){
+        std::uint64_t gen;
+        for(int spin = 0 ; (gen = m_generation.load(std::memory_order_acquire)) == seen ; ++spin){
+            if(spin >= spin_limit) m_generation.wait(seen , std::memory_order_acquire);
+        }
+        seen = gen;
+        if(m_stop.load(std::memory_order_relaxed)) return;
+        RunBlock(id);
+        m_pending.fetch_sub(1 , std::memory_order_release);
+    }
+}